@@ -1,4 +1,22 @@
 setlocal
 @echo off
 @call "c:\Program Files (x86)\Microsoft Visual Studio 12.0\VC\bin\vcvars32.bat"
-cl srch.cpp /nologo /EHsc /MT
+
+rem zlib and zstd are required.  ZLIB_DIR and ZSTD_DIR should each contain
+rem include\ and lib\ directories.  Override ZLIB_LIB/ZSTD_LIB if your build
+rem names the libraries differently (e.g. zlibstatic.lib, libzstd_static.lib)
+if "%ZLIB_DIR%"=="" (
+    echo ZLIB_DIR must be set to the zlib install directory
+    exit /b 1
+)
+if "%ZSTD_DIR%"=="" (
+    echo ZSTD_DIR must be set to the zstd install directory
+    exit /b 1
+)
+if "%ZLIB_LIB%"=="" set ZLIB_LIB=zlib.lib
+if "%ZSTD_LIB%"=="" set ZSTD_LIB=libzstd.lib
+
+cl srch.cpp /nologo /EHsc /MT ^
+    /I"%ZLIB_DIR%\include" /I"%ZSTD_DIR%\include" ^
+    %ZLIB_LIB% %ZSTD_LIB% ^
+    /link /LIBPATH:"%ZLIB_DIR%\lib" /LIBPATH:"%ZSTD_DIR%\lib"
@@ -4,15 +4,21 @@
  */
 #include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <locale>
 #include <map>
+#include <memory>
 #include <regex>
 #include <set>
 #include <sstream>
+#include <streambuf>
 #include <string>
 #include <cassert>
 
+#include <zlib.h>
+#include <zstd.h>
+
 using namespace std;
 using namespace std::tr2::sys;
 
@@ -242,6 +248,7 @@ struct options_t {
     bool no_filenames                   = false;
     bool count                          = false;
     bool dump_options                   = false;
+    bool decompress                     = false;
     int lines_before                    = 0;
     int lines_after                     = 0;
     int no_pattern                      = 0;
@@ -275,6 +282,7 @@ struct options_t {
             << "no_filenames         = " << no_filenames << endl
             << "no-pattern           = " << no_pattern << endl
             << "count                = " << count << endl
+            << "decompress           = " << decompress << endl
             << "lines_before         = " << lines_before << endl
             << "lines_after          = " << lines_after << endl
             << "included_files       = " << join(included_files) << endl
@@ -353,6 +361,9 @@ bool parse_options(
         else if (in(arg, set<string>{"-c", "--count"})) {
             options.count = true;
         }
+        else if (in(arg, set<string>{"-z", "--search-zip"})) {
+            options.decompress = true;
+        }
         else if (in(arg, set<string>{"--dump-options"})) {
             options.dump_options = true;
         }
@@ -452,6 +463,7 @@ void print_usage(string program_name)
 "-v, --invert-match         Return only lines which don't match PATTERN",
 "-w, --word-regexp          Only match if PATTERN is a word",
 "-Q, --literal              Match PATTERN as literal value, not regexp",
+"-z, --search-zip           Search inside gzip and zstd compressed files",
 "",
 "Search output:",
 "-l, --files-with-match     Print names of files that match PATTERN",
@@ -532,6 +544,260 @@ vector<regex> build_regexes(
     return regex_patterns;
 }
 
+enum class compression_t { none, gzip, zstd };
+
+/**
+ * identify compressed files by their magic bytes, not their extension - rotated
+ * logs are frequently named things like "server.log.1".  Leaves file
+ * positioned back at the start.
+ */
+compression_t detect_compression(istream& file)
+{
+    unsigned char magic[4] = {0};
+    file.read(reinterpret_cast<char*>(magic), sizeof(magic));
+    auto magic_size = file.gcount();
+    file.clear();
+    file.seekg(0);
+
+    if (magic_size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return compression_t::gzip;
+    if (magic_size == 4 && magic[0] == 0x28 && magic[1] == 0xb5
+            && magic[2] == 0x2f && magic[3] == 0xfd)
+        return compression_t::zstd;
+    return compression_t::none;
+}
+
+/**
+ * A streambuf that decompresses its source a block at a time, directly into
+ * the get area that getline reads from.  Memory use is bounded by the two
+ * block buffers, no matter how large the file is.
+ */
+class decompressing_streambuf : public streambuf {
+protected:
+    istream& source;
+    vector<char> in_buf;
+    vector<char> out_buf;
+    string error_message;
+
+    /** read the next block of compressed input.  Returns bytes read */
+    size_t read_block() {
+        source.read(in_buf.data(), in_buf.size());
+        return static_cast<size_t>(source.gcount());
+    }
+
+    /** decompress into out_buf.  Returns bytes produced.  On bad data, sets
+     * error_message but still returns whatever was decoded before it */
+    virtual size_t decompress_block() = 0;
+
+    /** make more compressed input available.  Returns false at end of file */
+    virtual bool fill_input() = 0;
+
+    /** true if the input seen so far ended on a complete frame/member */
+    virtual bool at_frame_boundary() const = 0;
+
+    int_type underflow() override {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        if (!error_message.empty())
+            return traits_type::eof();
+
+        // try to drain anything the decompressor has buffered before reading
+        // more input
+        for (;;) {
+            size_t produced = decompress_block();
+            if (produced > 0) {
+                setg(out_buf.data(), out_buf.data(),
+                        out_buf.data() + produced);
+                return traits_type::to_int_type(*gptr());
+            }
+            if (!error_message.empty())
+                return traits_type::eof();
+            if (!fill_input()) {
+                if (!at_frame_boundary())
+                    error_message = "unexpected end of compressed data";
+                return traits_type::eof();
+            }
+        }
+    }
+
+public:
+    decompressing_streambuf(istream& source_, size_t in_size, size_t out_size)
+        : source(source_), in_buf(in_size), out_buf(out_size)
+    {
+    }
+
+    string const& error() const {
+        return error_message;
+    }
+};
+
+/**
+ * gzip (and zlib) decompression.  Concatenated gzip members, as produced by
+ * appending to a .gz file, are read as one stream.
+ */
+class gzip_streambuf : public decompressing_streambuf {
+private:
+    z_stream stream;
+    bool member_open = false;
+    bool trailing_data = false;
+
+    /** does the unread input look like the start of another gzip or zlib
+     * member? */
+    bool at_member_header() const {
+        const Bytef* next = stream.next_in;
+        if (next[0] == 0x1f)
+            return stream.avail_in < 2 || next[1] == 0x8b;
+        if ((next[0] & 0x0f) == Z_DEFLATED)
+            return stream.avail_in < 2 || (next[0] * 256 + next[1]) % 31 == 0;
+        return false;
+    }
+
+    size_t decompress_block() override {
+        // like gzip -d, ignore padding (usually zeros) after the last member
+        if (!member_open && stream.avail_in > 0 && !at_member_header()) {
+            trailing_data = true;
+            stream.avail_in = 0;
+        }
+        if (trailing_data)
+            return 0;
+
+        if (stream.avail_in > 0)
+            member_open = true;
+
+        stream.next_out = reinterpret_cast<Bytef*>(out_buf.data());
+        stream.avail_out = static_cast<uInt>(out_buf.size());
+        int ret = inflate(&stream, Z_NO_FLUSH);
+        size_t produced = out_buf.size() - stream.avail_out;
+
+        if (ret == Z_STREAM_END) {
+            member_open = false;
+            inflateReset(&stream);
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            error_message = stream.msg ? stream.msg : "invalid gzip data";
+        }
+        return produced;
+    }
+
+    bool fill_input() override {
+        if (trailing_data)
+            return false;
+        if (stream.avail_in > 0)
+            return true;
+        size_t size = read_block();
+        stream.next_in = reinterpret_cast<Bytef*>(in_buf.data());
+        stream.avail_in = static_cast<uInt>(size);
+        return size > 0;
+    }
+
+    bool at_frame_boundary() const override {
+        return !member_open;
+    }
+
+public:
+    explicit gzip_streambuf(istream& source_)
+        : decompressing_streambuf(source_, 64 * 1024, 64 * 1024)
+    {
+        stream = z_stream();
+        // 15 window bits, +32 to detect gzip or zlib headers automatically.
+        // A failure here is reported like bad data, so only this file is
+        // skipped
+        if (inflateInit2(&stream, 15 + 32) != Z_OK)
+            error_message = "unable to initialize zlib";
+    }
+
+    ~gzip_streambuf() {
+        inflateEnd(&stream);
+    }
+
+    gzip_streambuf(gzip_streambuf const&) = delete;
+    gzip_streambuf& operator=(gzip_streambuf const&) = delete;
+};
+
+/**
+ * zstd decompression.  Buffer sizes are the ones zstd recommends, which
+ * guarantee that each call can make progress.
+ */
+class zstd_streambuf : public decompressing_streambuf {
+private:
+    ZSTD_DStream* stream;
+    ZSTD_inBuffer input;
+    bool frame_complete = false;
+
+    size_t decompress_block() override {
+        ZSTD_outBuffer output = {out_buf.data(), out_buf.size(), 0};
+        size_t input_pos = input.pos;
+        size_t ret = ZSTD_decompressStream(stream, &output, &input);
+        if (ZSTD_isError(ret)) {
+            error_message = ZSTD_getErrorName(ret);
+            return output.pos;
+        }
+
+        // zstd returns 0 exactly when a frame is completely decoded and
+        // flushed.  Calling again with no input returns the size of the next
+        // frame's header, so only a frame that has started consuming input
+        // counts as incomplete
+        if (ret == 0)
+            frame_complete = true;
+        else if (input.pos > input_pos)
+            frame_complete = false;
+        return output.pos;
+    }
+
+    bool fill_input() override {
+        if (input.pos < input.size)
+            return true;
+        size_t size = read_block();
+        input.src = in_buf.data();
+        input.size = size;
+        input.pos = 0;
+        return size > 0;
+    }
+
+    bool at_frame_boundary() const override {
+        return frame_complete;
+    }
+
+public:
+    explicit zstd_streambuf(istream& source_)
+        : decompressing_streambuf(source_,
+                ZSTD_DStreamInSize(), ZSTD_DStreamOutSize()),
+            stream(ZSTD_createDStream())
+    {
+        input.src = nullptr;
+        input.size = 0;
+        input.pos = 0;
+        if (stream == nullptr || ZSTD_isError(ZSTD_initDStream(stream)))
+            error_message = "unable to initialize zstd";
+    }
+
+    ~zstd_streambuf() {
+        ZSTD_freeDStream(stream);
+    }
+
+    zstd_streambuf(zstd_streambuf const&) = delete;
+    zstd_streambuf& operator=(zstd_streambuf const&) = delete;
+};
+
+/**
+ * returns a decompressing streambuf reading from file, or null if the
+ * compression type isn't one we decompress
+ */
+unique_ptr<decompressing_streambuf> make_decompressor(
+    compression_t compression,
+    istream& file
+    )
+{
+    switch (compression) {
+    case compression_t::gzip:
+        return unique_ptr<decompressing_streambuf>(new gzip_streambuf(file));
+    case compression_t::zstd:
+        return unique_ptr<decompressing_streambuf>(new zstd_streambuf(file));
+    default:
+        return nullptr;
+    }
+}
+
 /**
  * Returns matches in file, if options.filenames_only not set.  Otherwise
  * returns 1 or 0
@@ -548,12 +814,30 @@ int search_file(
     int lines_after_left = 0;
     int matches_in_file = 0;
 
+    // with decompression on, every file is opened once in binary mode so its
+    // magic bytes can be checked, and compressed files are decompressed as we
+    // go
+    ifstream file(file_path.path(), options.decompress
+            ? ios::in | ios::binary
+            : ios::in);
+    auto compression = options.decompress
+        ? detect_compression(file)
+        : compression_t::none;
+    auto decompressor = make_decompressor(compression, file);
+    streambuf* source = file.rdbuf();
+    if (decompressor)
+        source = decompressor.get();
+    istream input(source);
+
     // start looping through the file line by line
-    ifstream file(file_path.path());
     string line;
-    while (getline(file, line)) {
+    while (getline(input, line)) {
         line_number++;
 
+        // binary mode doesn't translate line endings for us
+        if (options.decompress && !line.empty() && line.back() == '\r')
+            line.pop_back();
+
         // any of the patterns present?
         bool found = options.literal_match 
             ? line_matches(line, patterns, options.ignore_case)
@@ -600,6 +884,9 @@ int search_file(
         }
     }
 
+    if (decompressor && !decompressor->error().empty())
+        cerr << fixup(file_path) << ": " << decompressor->error() << endl;
+
     return matches_in_file;
 }
 